@@ -0,0 +1,74 @@
+#include "blend.h"
+
+// x / 255, rounded, for x in [0, 255 * 255]
+#define DIV255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+// Moves dst towards value by a / 255
+#define LERP(dst, value, a) DIV255((value) * (a) + (dst) * (255 - (a)))
+
+// As LERP, for a value given multiplied by 255, so it is only rounded once
+#define LERP255(dst, value255, a) (((value255) * (a) + (dst) * 255 * (255 - (a)) + 32512) / (255 * 255))
+
+// Composites len pixels of src over dst. The effective alpha of each pixel is its own alpha
+// scaled by the layer alpha. The blend mode is resolved once per layer so the inner loops stay
+// branch-light.
+void blend_layer(RGB_t *dst, const RGBA_t *src, size_t len, uint8_t mode, uint8_t alpha) {
+    size_t i;
+    uint8_t k;
+    uint32_t a, s, d;
+
+    if (alpha == 0) {
+        return;
+    }
+
+    switch (mode) {
+        case LED_BLEND_NORMAL:
+            for (i = 0; i < len; i++, dst++, src++) {
+                a = DIV255(src->a * alpha);
+                if (a == 0) {
+                    continue;
+                }
+                if (a == 255) {
+                    dst->r = src->r;
+                    dst->g = src->g;
+                    dst->b = src->b;
+                    continue;
+                }
+                for (k = 0; k < 3; k++) {
+                    dst->subpixels[k] = LERP(dst->subpixels[k], src->subpixels[k], a);
+                }
+            }
+            break;
+        case LED_BLEND_ADD:
+            for (i = 0; i < len; i++, dst++, src++) {
+                a = DIV255(src->a * alpha);
+                for (k = 0; k < 3; k++) {
+                    d = dst->subpixels[k] + DIV255(src->subpixels[k] * a);
+                    dst->subpixels[k] = d > 255 ? 255 : d;
+                }
+            }
+            break;
+        case LED_BLEND_MULTIPLY:
+            for (i = 0; i < len; i++, dst++, src++) {
+                a = DIV255(src->a * alpha);
+                for (k = 0; k < 3; k++) {
+                    d = dst->subpixels[k];
+                    s = src->subpixels[k] * d;
+                    dst->subpixels[k] = LERP255(d, s, a);
+                }
+            }
+            break;
+        case LED_BLEND_SCREEN:
+            for (i = 0; i < len; i++, dst++, src++) {
+                a = DIV255(src->a * alpha);
+                for (k = 0; k < 3; k++) {
+                    d = dst->subpixels[k];
+                    s = (src->subpixels[k] + d) * 255 - src->subpixels[k] * d;
+                    dst->subpixels[k] = LERP255(d, s, a);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
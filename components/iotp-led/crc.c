@@ -0,0 +1,56 @@
+#include "crc.h"
+
+#define CRC32_POLY 0xEDB88320 /* IEEE 802.3, reflected */
+
+// Slice-by-4 tables: _crc_table[k][i] is the CRC of byte i followed by k zero bytes
+static uint32_t _crc_table[4][256];
+
+void led_crc32_init(void) {
+    uint32_t i, k, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+        }
+        _crc_table[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 4; k++) {
+            crc = _crc_table[k - 1][i];
+            _crc_table[k][i] = (crc >> 8) ^ _crc_table[0][crc & 0xff];
+        }
+    }
+}
+
+// Standard (zlib compatible) CRC32, processing a 32-bit word per step. Pass 0 as the initial crc.
+uint32_t led_crc32(uint32_t crc, const uint8_t *buf, size_t len) {
+    const uint32_t *words;
+
+    crc = ~crc;
+
+    // Byte-wise until the buffer is word aligned
+    while (len > 0 && ((uintptr_t)buf & 3) != 0) {
+        crc = (crc >> 8) ^ _crc_table[0][(crc ^ *buf++) & 0xff];
+        len--;
+    }
+
+    words = (const uint32_t *)buf;
+    while (len >= 4) {
+        crc ^= *words++; // Little-endian load, as on the ESP32
+        crc = _crc_table[3][crc & 0xff] ^
+            _crc_table[2][(crc >> 8) & 0xff] ^
+            _crc_table[1][(crc >> 16) & 0xff] ^
+            _crc_table[0][crc >> 24];
+        len -= 4;
+    }
+
+    buf = (const uint8_t *)words;
+    while (len > 0) {
+        crc = (crc >> 8) ^ _crc_table[0][(crc ^ *buf++) & 0xff];
+        len--;
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,18 @@
+#include <stddef.h>
+
+#include "pixels.h"
+
+#ifndef __BLEND_H
+#define __BLEND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void blend_layer(RGB_t *dst, const RGBA_t *src, size_t len, uint8_t mode, uint8_t alpha);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __CRC_H
+#define __CRC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void led_crc32_init(void);
+uint32_t led_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
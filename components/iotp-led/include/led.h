@@ -12,9 +12,25 @@ extern "C" {
 typedef void (*led_ack)(uint8_t ackID);
 typedef void (*led_log)(char *message);
 
+// Running totals since initialisation; unlike the per-second log counters these are never reset
+typedef struct {
+    uint32_t accepted;   // Stream frames written to the frame buffer
+    uint32_t dropped;    // Stream frames lost because the frame buffer was full
+    uint32_t rejected;   // Stream frames that failed the length or CRC checks
+    uint32_t skipped;    // Queued frames passed over to catch up (OTA mode)
+    uint32_t rendered;   // Frames sent to the LEDs
+    uint32_t slow_wakes; // Wakes from idle that took longer than CONFIG_LED_WAKE_LIMIT_US
+} led_stats_t;
+
 void led_initialise(led_log log_callback, led_ack ack_callback, int *gpios, size_t count);
 void led_set_running(uint8_t running);
-uint8_t led_push_stream(char *data);
+void led_set_ota(uint8_t ota);
+uint8_t led_push_stream(char *data, size_t length);
+uint8_t led_push_layer(char *data, size_t length);
+void led_set_layer(uint8_t index, uint8_t mode, uint8_t alpha, uint16_t len, RGBA_t *data);
+// Adds time the stream input (MQTT) task spent blocked elsewhere, reported as W in the LED FPS log
+void led_add_input_wait(uint32_t us);
+void led_get_stats(led_stats_t *stats);
 void led_task(void *pParam);
 
 #ifdef __cplusplus
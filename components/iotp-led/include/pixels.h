@@ -18,12 +18,45 @@ typedef struct __attribute__((__packed__)) {
     };
 } RGB_t;
 
+typedef struct __attribute__((__packed__)) {
+    union {
+        struct {
+            uint8_t r;
+            uint8_t g;
+            uint8_t b;
+            uint8_t a;
+        };
+        uint8_t subpixels[4];
+    };
+} RGBA_t;
+
+typedef enum {
+    LED_BLEND_NONE = 0, // Layer disabled
+    LED_BLEND_NORMAL,
+    LED_BLEND_ADD,
+    LED_BLEND_MULTIPLY,
+    LED_BLEND_SCREEN
+} led_blend_mode_t;
+
 typedef struct __attribute__((__packed__)) frame_t {
     uint8_t ackID;
     uint16_t len;
     RGB_t data[CONFIG_LED_NUM_PIXELS];
 } FRAME_t;
 
+#define FRAME_HEADER_SIZE (sizeof(FRAME_t) - sizeof(((FRAME_t *)0)->data))
+#define FRAME_CRC_SIZE sizeof(uint32_t)
+
+typedef struct __attribute__((__packed__)) layer_t {
+    uint8_t index;
+    uint8_t mode;
+    uint8_t alpha;
+    uint16_t len;
+    RGBA_t data[CONFIG_LED_NUM_PIXELS];
+} LAYER_t;
+
+#define LAYER_HEADER_SIZE (sizeof(LAYER_t) - sizeof(((LAYER_t *)0)->data))
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,8 +16,19 @@
 extern "C" {
 #endif
 
+typedef struct {
+    uint32_t refills;        // Threshold interrupts serviced
+    uint32_t underruns;      // Refills that were too late to beat the transmitter
+    uint32_t max_latency_us; // Worst time from a segment's expected wire time to its refill finishing
+} ws2811_channel_stats_t;
+
 extern void ws2811_init(int *gpioNum, size_t count);
 extern void ws2811_setColors(unsigned int length, RGB_t *array);
+extern void ws2811_getStats(uint8_t channel, ws2811_channel_stats_t *stats);
+extern void ws2811_resetStats(void);
+extern void ws2811_sleep(void);
+extern void ws2811_wake(void);
+extern uint8_t ws2811_calibrate(unsigned int length, RGB_t *array, uint16_t frames);
 
 #ifdef __cplusplus
 }
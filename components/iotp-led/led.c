@@ -1,10 +1,16 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+#include <string.h>
 
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "esp_timer.h"
 #include "mqtt_client.h"
 
+#include "blend.h"
+#include "crc.h"
 #include "ws2811.h"
 #include "led.h"
 #include "pixels.h"
@@ -13,6 +19,24 @@ const static char *TAG = "LED";
 
 FRAME_t _frame_buffer[CONFIG_LED_FRAME_BUFFER_SIZE];
 
+#if CONFIG_LED_NUM_LAYERS > 0
+typedef struct {
+    uint8_t mode;
+    uint8_t alpha;
+    uint16_t len;
+    RGBA_t data[CONFIG_LED_NUM_PIXELS];
+} led_layer_t;
+
+led_layer_t _layers[CONFIG_LED_NUM_LAYERS];
+SemaphoreHandle_t _layer_mutex = NULL;
+uint8_t _layers_dirty = false;
+
+// The last streamed frame is kept so layer changes can be re-composited without a new frame
+RGB_t _base[CONFIG_LED_NUM_PIXELS];
+uint16_t _base_len = CONFIG_LED_NUM_PIXELS;
+RGB_t _composite[CONFIG_LED_NUM_PIXELS];
+#endif
+
 bool _log = false;
 bool _log_peek_empty = false;
 bool _force_log_drop = false;
@@ -20,12 +44,37 @@ uint8_t _seq = 0;
 led_log _log_callback = NULL;
 led_ack _ack_callback = NULL;
 uint8_t _running = 0;
+uint8_t _ota = 0;
+uint8_t _channel_count = 0;
 uint8_t _head = 0;
 uint8_t _tail = 0;
 
 uint16_t _dropCount = 0;
+uint16_t _rejectLengthCount = 0;
+uint16_t _rejectCrcCount = 0;
+uint16_t _frameCount = 0;
+uint16_t _skipCount = 0;
+uint32_t _inputWait = 0;
+led_stats_t _stats;
+int64_t _maxFrameGap = 0;
+int64_t _lastFrame = 0;
 int64_t _sampling_start = 0;
 
+// Idle state: after CONFIG_LED_IDLE_TIMEOUT_MS without data the task blocks, the RMT clock is gated
+// and the power management lock is released so the CPU can drop frequency or light-sleep.
+SemaphoreHandle_t _data_ready = NULL;
+uint8_t _idle = false;
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+int64_t _lastActivity = 0;
+int64_t _idleStart = 0;
+int64_t _idleEnd = 0;
+int64_t _idleCpuTotal = 0;
+volatile int64_t _wakeRequest = 0;
+#endif
+#ifdef CONFIG_PM_ENABLE
+esp_pm_lock_handle_t _pm_lock = NULL;
+#endif
+
 // reads a byte from the buffer and return ERROR_EMPTY if buffer empty
 static FRAME_t * fifo_peek() {
     if (_head == _tail) {
@@ -72,8 +121,29 @@ static FRAME_t * fifo_read() {
     return _frame_buffer + _tail;
 }
 
+#ifdef CONFIG_LED_OTA_KEEP_RUNNING
+// discards all but the newest frame in the buffer and returns how many were discarded
+static uint8_t fifo_skip() {
+    uint8_t head = _head; // Read once, the writer may move it
+    uint8_t count = (head + CONFIG_LED_FRAME_BUFFER_SIZE - _tail) % CONFIG_LED_FRAME_BUFFER_SIZE;
+
+    if (count <= 1) {
+        return 0;
+    }
+
+    _tail = (head + CONFIG_LED_FRAME_BUFFER_SIZE - 1) % CONFIG_LED_FRAME_BUFFER_SIZE;
+    if (_log) {
+        char msg[60];
+        sprintf(msg, "BUF SKIP %d (H:%d, T:%d, S:%d)", count - 1, head, _tail, _seq);
+        _log_callback(msg);
+        _seq++;
+    }
+    return count - 1;
+}
+#endif
+
 // writes a byte to the buffer if not ERROR_FULL
-static uint8_t fifo_write(FRAME_t *frame) {
+static uint8_t fifo_write(FRAME_t *frame, size_t size) {
     uint8_t next_head = (_head + 1) % CONFIG_LED_FRAME_BUFFER_SIZE;
     if (next_head == _tail) {
         if (_force_log_drop || _log) {
@@ -84,10 +154,17 @@ static uint8_t fifo_write(FRAME_t *frame) {
         }
         //ESP_LOGI(TAG, "************ DROPPED FRAME (%s, H:%d, T:%d) ************", _running ? "running" : "stopped", _head, _tail);
         _dropCount++;
+        _stats.dropped++;
         return false;
     }
-    _frame_buffer[next_head] = *frame;
+    memcpy(_frame_buffer + next_head, frame, size);
     _head = next_head;
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+    if (_idle && _wakeRequest == 0) {
+        _wakeRequest = esp_timer_get_time();
+    }
+#endif
+    xSemaphoreGive(_data_ready);
     if (_log) {
         char msg[60];
         sprintf(msg, "BUF W %d (A:%d, H:%d, T:%d, S:%d)", _head, frame->ackID, _head, _tail, _seq);
@@ -101,6 +178,18 @@ void led_initialise(led_log log_callback, led_ack ack_callback, int *gpios, size
     _running = true;
     _log_callback = log_callback;
     _ack_callback = ack_callback;
+    _channel_count = count;
+    led_crc32_init();
+    _data_ready = xSemaphoreCreateBinary();
+#ifdef CONFIG_PM_ENABLE
+    // Held while active: the RMT timing depends on the APB clock, the refill ISR and blending need
+    // the full CPU clock, and light sleep would stop the RMT altogether
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "led", &_pm_lock);
+    esp_pm_lock_acquire(_pm_lock);
+#endif
+#if CONFIG_LED_NUM_LAYERS > 0
+    _layer_mutex = xSemaphoreCreateMutex();
+#endif
     ws2811_init(gpios, count);
 }
 
@@ -109,44 +198,384 @@ void led_set_running(uint8_t running) {
     _running = running;
 }
 
-uint8_t led_push_stream(char *data) {
-    return fifo_write((FRAME_t*)data);
+void led_set_ota(uint8_t ota) {
+    ESP_LOGI(TAG, "Setting LED OTA mode to %s.", ota ? "on" : "off");
+    _ota = ota;
+}
+
+// Checks that a payload is exactly `size` bytes, plus the CRC trailer if enabled
+static uint8_t payload_validate(uint8_t *data, size_t length, size_t size) {
+#ifdef CONFIG_LED_FRAME_CRC
+    uint32_t crc;
+    if (length != size + FRAME_CRC_SIZE) {
+        _rejectLengthCount++;
+        return false;
+    }
+
+    memcpy(&crc, data + size, FRAME_CRC_SIZE);
+    if (crc != led_crc32(0, data, size)) {
+        _rejectCrcCount++;
+        return false;
+    }
+#else
+    if (length != size) {
+        _rejectLengthCount++;
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// Checks the payload length against the frame header, and the CRC trailer if enabled
+static uint8_t frame_validate(FRAME_t *frame, size_t length) {
+    if (length < FRAME_HEADER_SIZE || frame->len > CONFIG_LED_NUM_PIXELS) {
+        _rejectLengthCount++;
+        return false;
+    }
+
+    return payload_validate((uint8_t *)frame, length, FRAME_HEADER_SIZE + frame->len * sizeof(RGB_t));
+}
+
+uint8_t led_push_stream(char *data, size_t length) {
+    FRAME_t *frame = (FRAME_t*)data;
+
+    if (!frame_validate(frame, length)) {
+        _stats.rejected++;
+        return false;
+    }
+    if (!fifo_write(frame, FRAME_HEADER_SIZE + frame->len * sizeof(RGB_t))) {
+        return false;
+    }
+    _stats.accepted++;
+    return true;
+}
+
+void led_set_layer(uint8_t index, uint8_t mode, uint8_t alpha, uint16_t len, RGBA_t *data) {
+#if CONFIG_LED_NUM_LAYERS > 0
+    if (index >= CONFIG_LED_NUM_LAYERS || len > CONFIG_LED_NUM_PIXELS) {
+        return;
+    }
+
+    xSemaphoreTake(_layer_mutex, portMAX_DELAY);
+    _layers[index].mode = mode;
+    _layers[index].alpha = alpha;
+    _layers[index].len = len;
+    memcpy(_layers[index].data, data, len * sizeof(RGBA_t));
+    _layers_dirty = true;
+    xSemaphoreGive(_layer_mutex);
+    xSemaphoreGive(_data_ready);
+#endif
+}
+
+uint8_t led_push_layer(char *data, size_t length) {
+#if CONFIG_LED_NUM_LAYERS > 0
+    LAYER_t *layer = (LAYER_t*)data;
+
+    if (length < LAYER_HEADER_SIZE || layer->len > CONFIG_LED_NUM_PIXELS) {
+        _rejectLengthCount++;
+        return false;
+    }
+
+    // Not a framing error, the publisher is addressing more layers than this build has
+    if (layer->index >= CONFIG_LED_NUM_LAYERS) {
+        ESP_LOGD(TAG, "Layer %d out of range", layer->index);
+        return false;
+    }
+
+    if (!payload_validate((uint8_t *)layer, length, LAYER_HEADER_SIZE + layer->len * sizeof(RGBA_t))) {
+        return false;
+    }
+
+    led_set_layer(layer->index, layer->mode, layer->alpha, layer->len, layer->data);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Sends a frame to the LEDs, compositing any layers over it. A NULL frame re-composites the
+// layers over the last frame.
+static void render(FRAME_t *frame) {
+#if CONFIG_LED_NUM_LAYERS > 0
+    uint8_t i;
+    uint16_t len;
+
+    if (frame != NULL) {
+        memcpy(_base, frame->data, frame->len * sizeof(RGB_t));
+        _base_len = frame->len;
+    }
+
+    xSemaphoreTake(_layer_mutex, portMAX_DELAY);
+    memcpy(_composite, _base, _base_len * sizeof(RGB_t));
+    for (i = 0; i < CONFIG_LED_NUM_LAYERS; i++) {
+        if (_layers[i].mode != LED_BLEND_NONE) {
+            len = _layers[i].len < _base_len ? _layers[i].len : _base_len;
+            blend_layer(_composite, _layers[i].data, len, _layers[i].mode, _layers[i].alpha);
+        }
+    }
+    _layers_dirty = false;
+    xSemaphoreGive(_layer_mutex);
+
+    ws2811_setColors(_base_len, _composite);
+#else
+    ws2811_setColors(frame->len, frame->data);
+#endif
+}
+
+// Logs per-channel RMT refill statistics for the sampling period, if anything went wrong
+static void log_rmt_stats() {
+    ws2811_channel_stats_t stats;
+    uint8_t chan;
+
+    for (chan = 0; chan < _channel_count; chan++) {
+        ws2811_getStats(chan, &stats);
+        if (stats.underruns > 0) {
+            char msg[60];
+            sprintf(msg, "RMT UNDERRUN %d/%d (C:%d, L:%dus, S:%d)", stats.underruns, stats.refills, chan, stats.max_latency_us, _seq);
+            _log_callback(msg);
+            _seq++;
+        }
+    }
+    ws2811_resetStats();
+}
+
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+#if defined(CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS) && defined(CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER)
+#define IDLE_CPU_STATS
+#endif
+
+// Idle CPU time is sampled at least this often while idle, well inside the ~71 minute wrap of the
+// 32-bit microsecond run time counters
+#define IDLE_SAMPLE_MS 60000
+
+#ifdef IDLE_CPU_STATS
+uint32_t _idleCpuLast[portNUM_PROCESSORS];
+#endif
+
+// Adds the idle tasks' run time since the last sample to _idleCpuTotal, or just takes a new starting
+// point if reset is set. Does nothing if run time stats are unavailable.
+static void cpu_idle_sample(uint8_t reset) {
+#ifdef IDLE_CPU_STATS
+    TaskStatus_t status;
+    int core;
+
+    for (core = 0; core < portNUM_PROCESSORS; core++) {
+        vTaskGetInfo(xTaskGetIdleTaskHandleForCPU(core), &status, pdFALSE, eInvalid);
+        if (!reset) {
+            // Unsigned difference, so a single wrap between samples is handled
+            _idleCpuTotal += (uint32_t)(status.ulRunTimeCounter - _idleCpuLast[core]);
+        }
+        _idleCpuLast[core] = status.ulRunTimeCounter;
+    }
+#endif
+}
+
+static void led_sleep() {
+    char msg[60];
+
+    sprintf(msg, "LED IDLE (S:%d)", _seq);
+    _log_callback(msg);
+    _seq++;
+
+    ws2811_sleep();
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_release(_pm_lock);
+#endif
+
+    _idleStart = esp_timer_get_time();
+    _idleCpuTotal = 0;
+    cpu_idle_sample(true);
+    _idle = true;
+}
+
+static void led_wake() {
+    _idleEnd = esp_timer_get_time();
+    cpu_idle_sample(false);
+
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(_pm_lock);
+#endif
+    ws2811_wake();
+    _idle = false;
+    _lastFrame = 0;
+}
+
+// Reports how long the first frame after idle took to reach the wire, checked against
+// CONFIG_LED_WAKE_LIMIT_US, and the CPU load while idle
+static void log_wake(int64_t now) {
+    char msg[60];
+    int64_t latency = now - _wakeRequest;
+    int64_t idle_time = _idleEnd - _idleStart;
+    uint8_t slow = latency > CONFIG_LED_WAKE_LIMIT_US;
+    float load = -1.0f;
+
+#ifdef IDLE_CPU_STATS
+    // _idleCpuTotal was closed off by led_wake, over the same window as idle_time
+    if (idle_time > 0) {
+        load = 100.0f * (1.0f - (float)_idleCpuTotal / ((float)idle_time * portNUM_PROCESSORS));
+    }
+#endif
+
+    if (slow) {
+        _stats.slow_wakes++;
+        ESP_LOGW(TAG, "Wake took %lldus, over the %dus limit", latency, CONFIG_LED_WAKE_LIMIT_US);
+    }
+
+    sprintf(msg, "LED WAKE %lldus%s (I:%llds, CPU:%.1f%%, S:%d)", latency, slow ? " SLOW" : "", idle_time / 1000000, load, _seq);
+    _log_callback(msg);
+    _seq++;
+    _wakeRequest = 0;
+}
+#endif
+
+void led_add_input_wait(uint32_t us) {
+    _inputWait += us;
+}
+
+void led_get_stats(led_stats_t *stats) {
+    *stats = _stats;
 }
 
 void led_task(void *pParam) {
     FRAME_t *frame;
     int64_t delta;
+    int64_t now;
+
+#ifdef CONFIG_LED_RMT_CALIBRATE
+    // Calibrate with a full-length frame; the wire timing doesn't depend on the colours
+    frame = calloc(1, sizeof(FRAME_t));
+    if (frame != NULL) {
+        ws2811_calibrate(CONFIG_LED_NUM_PIXELS, frame->data, CONFIG_LED_RMT_CALIBRATE_FRAMES);
+        free(frame);
+    }
+    else {
+        ESP_LOGW(TAG, "No memory for RMT calibration, keeping the default buffer split");
+    }
+#endif
 
     _sampling_start = esp_timer_get_time();
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+    _lastActivity = _sampling_start;
+#endif
 
     while(true) {
         delta = esp_timer_get_time() - _sampling_start;
-        if (delta > 1000000) {
+        if (delta > 1000000 && !_idle) {
             float fps = (float)_dropCount / ((float)delta / 1000000.0f);
             char msg[60];
             sprintf(msg, "BUF DROP FPS %.1f (S:%d)", fps, _seq);
             _log_callback(msg);
             _seq++;
 
+            // Report the render rate so the impact of an OTA is visible
+            fps = (float)_frameCount / ((float)delta / 1000000.0f);
+            sprintf(msg, "LED FPS %.1f (G:%lldms, K:%d, OTA:%d, W:%dms, S:%d)", fps, _maxFrameGap / 1000, _skipCount, _ota, _inputWait / 1000, _seq);
+            _log_callback(msg);
+            _seq++;
+
+            if (_rejectLengthCount > 0 || _rejectCrcCount > 0) {
+                sprintf(msg, "BUF REJECT (L:%d, C:%d, S:%d)", _rejectLengthCount, _rejectCrcCount, _seq);
+                _log_callback(msg);
+                _seq++;
+            }
+
+            log_rmt_stats();
+
             // Reset sampling period
             _dropCount = 0;
+            _rejectLengthCount = 0;
+            _rejectCrcCount = 0;
+            _frameCount = 0;
+            _skipCount = 0;
+            _inputWait = 0;
+            _maxFrameGap = 0;
             _sampling_start = esp_timer_get_time();
         }
 
         if (_running) {
             frame = fifo_peek(); // Only peek the frame so the memory doesn't get overwritten
             if (frame != NULL) {
-                ws2811_setColors(frame->len, frame->data);
+#ifdef CONFIG_LED_OTA_KEEP_RUNNING
+                if (_ota) {
+                    // Rendering at a reduced rate, so show the newest frame rather than falling behind
+                    uint8_t skipped = fifo_skip();
+                    _skipCount += skipped;
+                    _stats.skipped += skipped;
+                    frame = fifo_peek();
+                }
+#endif
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+                if (_idle) {
+                    led_wake();
+                }
+#endif
+
+                render(frame);
                 _ack_callback(frame->ackID);
 
+                now = esp_timer_get_time();
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+                if (_wakeRequest != 0) {
+                    log_wake(now);
+                    _sampling_start = now;
+                }
+                _lastActivity = now;
+#endif
+                if (_lastFrame != 0 && now - _lastFrame > _maxFrameGap) {
+                    _maxFrameGap = now - _lastFrame;
+                }
+                _lastFrame = now;
+                _frameCount++;
+                _stats.rendered++;
+
                 fifo_read(); // Consume the frame
+#ifdef CONFIG_LED_OTA_KEEP_RUNNING
+                if (_ota) {
+                    // Render at a reduced rate to leave CPU time for the download and flash writes
+                    vTaskDelay(CONFIG_LED_OTA_FRAME_INTERVAL_MS / portTICK_PERIOD_MS);
+                    continue;
+                }
+#endif
                 vTaskDelay(0 / portTICK_PERIOD_MS);
             }
-            else {
+#if CONFIG_LED_NUM_LAYERS > 0
+            else if (_layers_dirty) {
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+                if (_idle) {
+                    led_wake();
+                    _wakeRequest = 0;
+                    _sampling_start = esp_timer_get_time();
+                }
+#endif
+
+                render(NULL);
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+                _lastActivity = esp_timer_get_time();
+#endif
                 vTaskDelay(0 / portTICK_PERIOD_MS);
             }
+#endif
+            else {
+#if CONFIG_LED_IDLE_TIMEOUT_MS > 0
+                if (!_idle && esp_timer_get_time() - _lastActivity > CONFIG_LED_IDLE_TIMEOUT_MS * 1000LL) {
+                    led_sleep();
+                }
+
+                // Block until new data arrives rather than polling; wake periodically while active
+                // for the sampling log and the idle check, and rarely while idle to sample CPU time
+                if (_idle) {
+                    cpu_idle_sample(false);
+                }
+                xSemaphoreTake(_data_ready, (_idle ? IDLE_SAMPLE_MS : 100) / portTICK_PERIOD_MS);
+#else
+                // Block until new data arrives rather than polling; wake periodically for the sampling log
+                xSemaphoreTake(_data_ready, 100 / portTICK_PERIOD_MS);
+#endif
+            }
         }
         else {
+            _lastFrame = 0;
             vTaskDelay(1000 / portTICK_PERIOD_MS);
         }
     }
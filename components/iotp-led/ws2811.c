@@ -25,6 +25,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <driver/rmt.h>
+#include <esp_heap_caps.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
 
 #include "esp_log.h"
 
@@ -42,11 +45,13 @@
 #define ZERO_HIGH_TICKS 10
 #define ZERO_LOW_TICKS 40
 #define RESET_TICKS 1000
+#define PULSE_NS ((ONE_HIGH_TICKS + ONE_LOW_TICKS) * DURATION * DIVIDER) /* wire time of one bit */
 
 #define TOTAL_BLOCKS 8
 #define PULSES_PER_BLOCK 64
 
 #define MAX_CHANNELS 8
+#define MAX_SEGMENTS 8
 
 const static char *TAG = "WS2811";
 
@@ -55,8 +60,11 @@ typedef struct {
     uint16_t buffer_len;
     uint8_t dirty;
     uint16_t pos;
-    uint8_t half;
+    uint8_t segment;
     xSemaphoreHandle sem;
+    int64_t start;
+    uint32_t events;
+    ws2811_channel_stats_t stats;
 } ws2811_channel_send_state_t;
 
 static intr_handle_t rmt_intr_handle;
@@ -65,6 +73,8 @@ static ws2811_channel_send_state_t _send_states[MAX_CHANNELS];
 static uint32_t _blocks_per_channel;
 static uint32_t _channel_pulses;
 static uint32_t _write_pulses;
+static uint32_t _segments = 2;
+static uint32_t _segment_us;
 static uint8_t _channel_count;
 static uint8_t _channel_to_rmt[MAX_CHANNELS];
 
@@ -91,15 +101,16 @@ void ws2811_initRMTChannel(uint8_t rmtChannel)
     return;
 }
 
-void ws2811_copy(uint8_t rmtChannel)
+// Kept in IRAM so refills carry on while flash writes (e.g. OTA) disable the cache
+void IRAM_ATTR ws2811_copy(uint8_t rmtChannel)
 {
     uint16_t i, offset, len;
     uint8_t j, bit;
 
     ws2811_channel_send_state_t *send_state = _send_states + rmtChannel;
 
-    offset = send_state->half * _write_pulses;
-    send_state->half = !send_state->half;
+    offset = send_state->segment * _write_pulses;
+    send_state->segment = (send_state->segment + 1) % _segments;
 
     len = send_state->buffer_len - send_state->pos;
     if (len > (_write_pulses / 8))
@@ -141,14 +152,38 @@ void ws2811_copy(uint8_t rmtChannel)
     return;
 }
 
-void ws2811_handleInterrupt(void *arg)
+// Called on a threshold event. The event for the n-th segment should arrive n segment-times after
+// tx_start; the segment being refilled is read again (_segments - 1) segment-times later, so a refill
+// that hasn't finished by then has let the transmitter send stale data. The time is taken after the
+// copy so a refill that starts in time but finishes late still counts.
+void IRAM_ATTR ws2811_refill(uint8_t rmtChannel)
+{
+    ws2811_channel_send_state_t *send_state = _send_states + rmtChannel;
+    int64_t expected, latency;
+
+    ws2811_copy(rmtChannel);
+
+    send_state->events++;
+    expected = send_state->start + (int64_t)send_state->events * _segment_us;
+    latency = esp_timer_get_time() - expected;
+    if (latency < 0)
+        latency = 0;
+
+    send_state->stats.refills++;
+    if (latency > send_state->stats.max_latency_us)
+        send_state->stats.max_latency_us = latency;
+    if (latency >= (int64_t)(_segments - 1) * _segment_us)
+        send_state->stats.underruns++;
+}
+
+void IRAM_ATTR ws2811_handleInterrupt(void *arg)
 {
     portBASE_TYPE taskAwoken = 0;
 
     // Handle channel 0
     if (RMT.int_st.ch0_tx_thr_event)
     {
-        ws2811_copy(0);
+        ws2811_refill(0);
         RMT.int_clr.ch0_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch0_tx_end && _send_states[0].sem)
@@ -159,7 +194,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 1
     else if (RMT.int_st.ch1_tx_thr_event)
     {
-        ws2811_copy(1);
+        ws2811_refill(1);
         RMT.int_clr.ch1_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch1_tx_end && _send_states[1].sem)
@@ -170,7 +205,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 2
     else if (RMT.int_st.ch2_tx_thr_event)
     {
-        ws2811_copy(2);
+        ws2811_refill(2);
         RMT.int_clr.ch2_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch2_tx_end && _send_states[2].sem)
@@ -181,7 +216,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 3
     else if (RMT.int_st.ch3_tx_thr_event)
     {
-        ws2811_copy(3);
+        ws2811_refill(3);
         RMT.int_clr.ch3_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch3_tx_end && _send_states[3].sem)
@@ -192,7 +227,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 4
     if (RMT.int_st.ch4_tx_thr_event)
     {
-        ws2811_copy(4);
+        ws2811_refill(4);
         RMT.int_clr.ch4_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch4_tx_end && _send_states[4].sem)
@@ -203,7 +238,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 5
     else if (RMT.int_st.ch5_tx_thr_event)
     {
-        ws2811_copy(5);
+        ws2811_refill(5);
         RMT.int_clr.ch5_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch5_tx_end && _send_states[5].sem)
@@ -214,7 +249,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 6
     else if (RMT.int_st.ch6_tx_thr_event)
     {
-        ws2811_copy(6);
+        ws2811_refill(6);
         RMT.int_clr.ch6_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch6_tx_end && _send_states[6].sem)
@@ -225,7 +260,7 @@ void ws2811_handleInterrupt(void *arg)
     // Handle channel 7
     else if (RMT.int_st.ch7_tx_thr_event)
     {
-        ws2811_copy(7);
+        ws2811_refill(7);
         RMT.int_clr.ch7_tx_thr_event = 1;
     }
     else if (RMT.int_st.ch7_tx_end && _send_states[7].sem)
@@ -237,16 +272,30 @@ void ws2811_handleInterrupt(void *arg)
     return;
 }
 
+// Splits each channel's RMT memory into `segments` equal parts that are refilled one at a time.
+// Fewer segments means fewer interrupts, but less time to service each one.
+static void ws2811_setLayout(uint32_t segments)
+{
+    uint8_t chan;
+
+    _segments = segments;
+    _write_pulses = _channel_pulses / _segments;
+    _segment_us = (_write_pulses * PULSE_NS) / 1000;
+
+    for (chan = 0; chan < _channel_count; chan++) {
+        RMT.tx_lim_ch[_channel_to_rmt[chan]].limit = _write_pulses;
+    }
+}
+
 void ws2811_init(int *gpioNum, size_t count)
 {
     uint8_t chan;
 
     _blocks_per_channel = TOTAL_BLOCKS / count;
     _channel_pulses = _blocks_per_channel * PULSES_PER_BLOCK;
-    _write_pulses = _channel_pulses / 2; // We write half of the buffer at a time
     _channel_count = count;
 
-    ESP_LOGI(TAG, "Initialising bpc %d, cp %d, wp %d, cc %d", _blocks_per_channel, _channel_pulses, _write_pulses, _channel_count);
+    ESP_LOGI(TAG, "Initialising bpc %d, cp %d, cc %d", _blocks_per_channel, _channel_pulses, _channel_count);
 
     DPORT_SET_PERI_REG_MASK(DPORT_PERIP_CLK_EN_REG, DPORT_RMT_CLK_EN);
     DPORT_CLEAR_PERI_REG_MASK(DPORT_PERIP_RST_EN_REG, DPORT_RMT_RST);
@@ -309,12 +358,14 @@ void ws2811_init(int *gpioNum, size_t count)
         uint8_t rmt_channel = _channel_to_rmt[chan];
         rmt_set_pin((rmt_channel_t)rmt_channel, RMT_MODE_TX, (gpio_num_t)gpioNum[chan]);
         ws2811_initRMTChannel(rmt_channel);
-        RMT.tx_lim_ch[rmt_channel].limit = _write_pulses;
 
         ESP_LOGI(TAG, "Initialised RMT channel %d on gpio %d", rmt_channel, gpioNum[chan]);
     }
 
-    esp_intr_alloc(ETS_RMT_INTR_SOURCE, 0, ws2811_handleInterrupt, NULL, &rmt_intr_handle);
+    ws2811_setLayout(_segments);
+    ESP_LOGI(TAG, "Using %d segments, wp %d", _segments, _write_pulses);
+
+    esp_intr_alloc(ETS_RMT_INTR_SOURCE, ESP_INTR_FLAG_IRAM, ws2811_handleInterrupt, NULL, &rmt_intr_handle);
 
     return;
 }
@@ -333,7 +384,8 @@ void ws2811_setColors(unsigned int length, RGB_t *array)
         uint8_t rmt_channel = _channel_to_rmt[chan];
         ws2811_channel_send_state_t *send_state = _send_states + rmt_channel;
 
-        send_state->buffer = malloc(channel_buffer_len);
+        // The ISR reads this buffer, so it must stay accessible with the cache disabled
+        send_state->buffer = heap_caps_malloc(channel_buffer_len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
         send_state->buffer_len = channel_buffer_len;
         buffer_end = (chan + 1) * array_len_per_channel;
         for (i = 0; j < buffer_end; j++, i++)
@@ -344,18 +396,21 @@ void ws2811_setColors(unsigned int length, RGB_t *array)
         }
 
         send_state->pos = 0;
-        send_state->half = 0;
+        send_state->segment = 0;
     }
 
     for (chan = 0; chan < _channel_count; chan++) {
         uint8_t rmt_channel = _channel_to_rmt[chan];
         ws2811_channel_send_state_t *send_state = _send_states + rmt_channel;
 
-        ws2811_copy(rmt_channel);
-        if (send_state->pos < send_state->buffer_len)
+        // Fill every segment up front, so a short frame is terminated before the first refill
+        do {
             ws2811_copy(rmt_channel);
+        } while (send_state->segment != 0);
 
         send_state->sem = xSemaphoreCreateBinary();
+        send_state->events = 0;
+        send_state->start = esp_timer_get_time();
 
         RMT.conf_ch[rmt_channel].conf1.mem_rd_rst = 1;
         RMT.conf_ch[rmt_channel].conf1.tx_start = 1;
@@ -374,3 +429,71 @@ void ws2811_setColors(unsigned int length, RGB_t *array)
 
     return;
 }
+
+// Gates the RMT clock while the strip holds its last frame. Must not be called mid-frame.
+void ws2811_sleep(void)
+{
+    DPORT_CLEAR_PERI_REG_MASK(DPORT_PERIP_CLK_EN_REG, DPORT_RMT_CLK_EN);
+}
+
+void ws2811_wake(void)
+{
+    // Gating the clock doesn't reset the peripheral, so the configuration is still in place
+    DPORT_SET_PERI_REG_MASK(DPORT_PERIP_CLK_EN_REG, DPORT_RMT_CLK_EN);
+}
+
+void ws2811_getStats(uint8_t channel, ws2811_channel_stats_t *stats)
+{
+    *stats = _send_states[_channel_to_rmt[channel]].stats;
+}
+
+void ws2811_resetStats(void)
+{
+    uint8_t chan;
+
+    for (chan = 0; chan < _channel_count; chan++) {
+        memset(&_send_states[_channel_to_rmt[chan]].stats, 0, sizeof(ws2811_channel_stats_t));
+    }
+}
+
+uint8_t ws2811_calibrate(unsigned int length, RGB_t *array, uint16_t frames)
+{
+    uint32_t segments, best_segments = 0, best_underruns = UINT32_MAX;
+    uint32_t underruns;
+    uint16_t frame;
+    uint8_t chan;
+    ws2811_channel_stats_t stats;
+
+    // Every channel already owns all of the memory blocks it can, so the only remaining trade-off is
+    // how finely that memory is split. Try the coarsest split (lowest interrupt rate) first.
+    for (segments = 2; segments <= MAX_SEGMENTS && (_channel_pulses / segments) % 8 == 0; segments *= 2) {
+        ws2811_setLayout(segments);
+        ws2811_resetStats();
+
+        for (frame = 0; frame < frames; frame++) {
+            ws2811_setColors(length, array);
+        }
+
+        underruns = 0;
+        for (chan = 0; chan < _channel_count; chan++) {
+            ws2811_getStats(chan, &stats);
+            underruns += stats.underruns;
+            ESP_LOGI(TAG, "Calibrate segments %d, channel %d: refills %d, underruns %d, max latency %dus",
+                segments, chan, stats.refills, stats.underruns, stats.max_latency_us);
+        }
+
+        if (underruns < best_underruns) {
+            best_underruns = underruns;
+            best_segments = segments;
+        }
+        if (underruns == 0) {
+            break;
+        }
+    }
+
+    ws2811_setLayout(best_segments);
+    ws2811_resetStats();
+
+    ESP_LOGI(TAG, "Calibrated to %d segments of %d pulses (tx_lim), %d underruns", _segments, _write_pulses, best_underruns);
+    return _segments;
+}
@@ -1,6 +1,14 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
+#include "esp32/pm.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "nvs_flash.h"
 
 #include "mqtt_client.h"
@@ -9,6 +17,8 @@
 #include "led.h"
 
 #define STACK_SIZE 4096
+#define OTA_CORE 0
+#define LED_CORE (portNUM_PROCESSORS - 1)
 
 static const char *TAG = "LEDRX";
 static const char *SOFTWARE = "ledrx";
@@ -23,12 +33,113 @@ extern const uint8_t version_end[] asm("_binary_version_txt_end");
 static mqtt_ota_state_handle_t _mqtt_ota_state;
 static uint8_t _tasks_started = false;
 static uint8_t _ackID = 0;
+static uint8_t _ota_running = false;
 
 static void subscribe_led_stream(esp_mqtt_client_handle_t client, const char *advertise_topic) {
     int msg_id = esp_mqtt_client_subscribe(client, advertise_topic, 0);
     ESP_LOGI(TAG, "Sent subscribe to %s, msg_id=%d", advertise_topic, msg_id);
 }
 
+#if defined(CONFIG_LED_OTA_KEEP_RUNNING) && CONFIG_OTA_THROTTLE_KBPS > 0
+#define OTA_THROTTLE
+
+// A copy of an OTA message, so it can be handled after the MQTT event has been released
+typedef struct {
+    esp_mqtt_event_t event;
+    char *buffer;
+} ota_chunk_t;
+
+// The backlog is limited by time rather than chunk count: no more OTA data is held than the throttle
+// writes in one OTA frame interval, so a stream frame queued behind it waits about a frame at most.
+// One chunk is always accepted, however large, so the download can't stall.
+#define OTA_BACKLOG_BYTES (CONFIG_OTA_THROTTLE_KBPS * 1024 * CONFIG_LED_OTA_FRAME_INTERVAL_MS / 1000)
+// Only a cap on the number of tiny chunks; the byte limit above normally applies first
+#define OTA_QUEUE_LEN 16
+
+static QueueHandle_t _ota_queue = NULL;
+static SemaphoreHandle_t _ota_space = NULL;
+static portMUX_TYPE _ota_lock = portMUX_INITIALIZER_UNLOCKED;
+static size_t _ota_queued = 0;
+
+// Hands OTA data to the throttle task instead of handling it on the MQTT task, so stream frames
+// received behind it aren't delayed. Returns false if the data should be handled directly.
+static uint8_t queue_ota_data(esp_mqtt_event_handle_t event) {
+    ota_chunk_t chunk;
+    int64_t wait_start;
+    uint8_t fits;
+
+    // Keep queueing until the queue drains, so chunks stay in order when the OTA ends
+    if (!_ota_running && uxQueueMessagesWaiting(_ota_queue) == 0) {
+        return false;
+    }
+
+    chunk.event = *event;
+    chunk.buffer = malloc(event->topic_len + event->data_len);
+    if (chunk.buffer == NULL) {
+        ESP_LOGW(TAG, "No memory to queue OTA data, handling it directly");
+        return false;
+    }
+
+    memcpy(chunk.buffer, event->topic, event->topic_len);
+    memcpy(chunk.buffer + event->topic_len, event->data, event->data_len);
+    chunk.event.topic = chunk.buffer;
+    chunk.event.data = chunk.buffer + event->topic_len;
+
+    // Wait for the throttle task to work the backlog down, and report how long the MQTT task was held
+    wait_start = esp_timer_get_time();
+    while (true) {
+        fits = uxQueueSpacesAvailable(_ota_queue) > 0;
+        portENTER_CRITICAL(&_ota_lock);
+        fits = fits && (_ota_queued == 0 || _ota_queued + event->data_len <= OTA_BACKLOG_BYTES);
+        if (fits) {
+            _ota_queued += event->data_len;
+        }
+        portEXIT_CRITICAL(&_ota_lock);
+        if (fits) {
+            break;
+        }
+        xSemaphoreTake(_ota_space, portMAX_DELAY);
+    }
+    led_add_input_wait(esp_timer_get_time() - wait_start);
+
+    // This is the only sender and there is space, so this doesn't block
+    xQueueSend(_ota_queue, &chunk, portMAX_DELAY);
+    return true;
+}
+
+// Writes queued OTA data at no more than CONFIG_OTA_THROTTLE_KBPS
+static void ota_throttle_task(void *pParam) {
+    ota_chunk_t chunk;
+    int64_t window_start = 0;
+    int64_t window_bytes = 0;
+    int64_t now, budget, elapsed;
+
+    while (true) {
+        xQueueReceive(_ota_queue, &chunk, portMAX_DELAY);
+        mqtt_ota_handle_data(_mqtt_ota_state, &chunk.event, CONFIG_OTA_TOPIC_ADVERTISE);
+        free(chunk.buffer);
+
+        portENTER_CRITICAL(&_ota_lock);
+        _ota_queued -= chunk.event.data_len;
+        portEXIT_CRITICAL(&_ota_lock);
+        xSemaphoreGive(_ota_space);
+
+        now = esp_timer_get_time();
+        if (window_start == 0 || now - window_start > 1000000) {
+            window_start = now;
+            window_bytes = 0;
+        }
+        window_bytes += chunk.event.data_len;
+
+        budget = (window_bytes * 1000000) / (CONFIG_OTA_THROTTLE_KBPS * 1024);
+        elapsed = now - window_start;
+        if (budget > elapsed) {
+            vTaskDelay(((budget - elapsed) / 1000) / portTICK_PERIOD_MS);
+        }
+    }
+}
+#endif
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 {
     switch (event->event_id) {
@@ -42,6 +153,9 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
             // Hook-up LED stream
             subscribe_led_stream(event->client, CONFIG_LED_TOPIC_STREAM);
+#if CONFIG_LED_NUM_LAYERS > 0
+            subscribe_led_stream(event->client, CONFIG_LED_TOPIC_LAYER);
+#endif
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
@@ -58,9 +172,19 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
             break;
         case MQTT_EVENT_DATA:
             if (event->topic_len > 0 && strncmp(event->topic, CONFIG_LED_TOPIC_STREAM, event->topic_len) == 0) {
-                led_push_stream(event->data);
+                led_push_stream(event->data, event->data_len);
+            }
+#if CONFIG_LED_NUM_LAYERS > 0
+            else if (event->topic_len > 0 && strncmp(event->topic, CONFIG_LED_TOPIC_LAYER, event->topic_len) == 0) {
+                led_push_layer(event->data, event->data_len);
             }
+#endif
             else {
+#ifdef OTA_THROTTLE
+                if (queue_ota_data(event)) {
+                    break;
+                }
+#endif
                 mqtt_ota_handle_data(_mqtt_ota_state, event, CONFIG_OTA_TOPIC_ADVERTISE);
             }
             break;
@@ -90,15 +214,30 @@ static esp_mqtt_client_handle_t mqtt_app_start(void)
 }
 
 static void handle_ota_state_change(uint8_t started) {
+    _ota_running = started;
+#ifdef CONFIG_LED_OTA_KEEP_RUNNING
+    led_set_ota(started);
+#else
     led_set_running(!started);
+#endif
 }
 
 void start_tasks(void) {
+#ifdef OTA_THROTTLE
+    // Created before the client starts, since the MQTT event handler uses them
+    _ota_queue = xQueueCreate(OTA_QUEUE_LEN, sizeof(ota_chunk_t));
+    _ota_space = xSemaphoreCreateBinary();
+#endif
+
     esp_mqtt_client_handle_t client = mqtt_app_start();
     _mqtt_ota_state = mqtt_ota_init(client, SOFTWARE, (const char *)version_start, handle_ota_state_change);
-    xTaskCreate(mqtt_ota_task, "ota", STACK_SIZE, _mqtt_ota_state, 5, NULL);
+    // Keep the download/flash path off the render core, and below the LED task's priority
+    xTaskCreatePinnedToCore(mqtt_ota_task, "ota", STACK_SIZE, _mqtt_ota_state, 4, NULL, OTA_CORE);
+#ifdef OTA_THROTTLE
+    xTaskCreatePinnedToCore(ota_throttle_task, "ota_throttle", STACK_SIZE, NULL, 4, NULL, OTA_CORE);
+#endif
 
-    xTaskCreate(led_task, "led", STACK_SIZE, NULL, 5, NULL);
+    xTaskCreatePinnedToCore(led_task, "led", STACK_SIZE, NULL, 5, NULL, LED_CORE);
 }
 
 void time_sync_notification_cb(struct timeval *tv)
@@ -165,6 +304,18 @@ void app_main()
     }
     ESP_ERROR_CHECK( err );
 
+#ifdef CONFIG_PM_ENABLE
+    // The LED component holds a CPU_FREQ_MAX lock while rendering, so this only takes effect once it goes idle
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = 80,
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true
+#endif
+    };
+    ESP_ERROR_CHECK( esp_pm_configure(&pm_config) );
+#endif
+
     wifi_init(CONFIG_WIFI_SSID, CONFIG_WIFI_PASSWORD);
     initialize_sntp();
 
@@ -0,0 +1,49 @@
+import argparse
+import sys
+import time
+
+import capture_format
+import mqtt_args
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Record LED stream payloads with their arrival times.')
+    mqtt_args.add_arguments(parser)
+    parser.add_argument('--duration', type=float, default=0, help='Seconds to record, 0 until interrupted')
+    parser.add_argument('output', help='Capture file to write')
+    args = parser.parse_args()
+
+    with open(args.output, 'wb') as f:
+        capture_format.write_header(f)
+        start = None
+        count = 0
+
+        def on_message(client, userdata, msg):
+            nonlocal start, count
+            now = time.perf_counter()
+            if start is None:
+                start = now
+            capture_format.write_record(f, int((now - start) * 1000000), msg.payload)
+            count += 1
+
+        client = mqtt_args.connect(args, on_message)
+        client.subscribe(args.topic, 0)
+        client.loop_start()
+
+        try:
+            if args.duration > 0:
+                time.sleep(args.duration)
+            else:
+                while True:
+                    time.sleep(1)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            client.loop_stop()
+            client.disconnect()
+
+    print('Captured {} frames to {}'.format(count, args.output), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
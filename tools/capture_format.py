@@ -0,0 +1,35 @@
+import struct
+
+# Capture file layout: a header, then one record per stream payload.
+#   header: magic (4 bytes), version (uint16)
+#   record: arrival time in microseconds since capture start (uint64), payload length (uint32), payload
+MAGIC = b'LRXC'
+VERSION = 1
+
+_header = struct.Struct('<4sH')
+_record = struct.Struct('<QI')
+
+
+def write_header(f):
+    f.write(_header.pack(MAGIC, VERSION))
+
+
+def write_record(f, time_us, payload):
+    f.write(_record.pack(time_us, len(payload)))
+    f.write(payload)
+
+
+def read_records(f):
+    magic, version = _header.unpack(f.read(_header.size))
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('Not a ledrx capture (magic {}, version {})'.format(magic, version))
+
+    while True:
+        data = f.read(_record.size)
+        if len(data) < _record.size:
+            return
+        time_us, length = _record.unpack(data)
+        payload = f.read(length)
+        if len(payload) < length:
+            return
+        yield time_us, payload
@@ -0,0 +1,94 @@
+// Checks each blend mode against a floating point reference, to within 1 LSB per subpixel
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "blend.h"
+
+#define PIXELS 4096
+
+// Expected result for one subpixel, with alpha as a fraction
+static double reference(uint8_t mode, double s, double d, double a) {
+    switch (mode) {
+        case LED_BLEND_NORMAL:
+            return s * a + d * (1 - a);
+        case LED_BLEND_ADD:
+            return d + s * a > 255 ? 255 : d + s * a;
+        case LED_BLEND_MULTIPLY:
+            return (s * d / 255) * a + d * (1 - a);
+        case LED_BLEND_SCREEN:
+            return (s + d - s * d / 255) * a + d * (1 - a);
+        default:
+            return d;
+    }
+}
+
+static int check(uint8_t mode, const char *name, uint8_t alpha, size_t len) {
+    static RGB_t base[PIXELS], dst[PIXELS];
+    static RGBA_t src[PIXELS];
+    size_t i;
+    uint8_t k;
+    double a, expected, error, worst = 0;
+    int failures = 0;
+
+    for (i = 0; i < PIXELS; i++) {
+        for (k = 0; k < 3; k++) {
+            base[i].subpixels[k] = rand();
+            src[i].subpixels[k] = rand();
+        }
+        // Cover the per-pixel alpha extremes as well as random values
+        src[i].a = i % 4 == 0 ? 0 : i % 4 == 1 ? 255 : rand();
+        dst[i] = base[i];
+    }
+
+    blend_layer(dst, src, len, mode, alpha);
+
+    for (i = 0; i < PIXELS; i++) {
+        a = (src[i].a / 255.0) * (alpha / 255.0);
+        for (k = 0; k < 3; k++) {
+            // Pixels beyond len must be left alone
+            expected = i < len ? reference(mode, src[i].subpixels[k], base[i].subpixels[k], a) : base[i].subpixels[k];
+            error = dst[i].subpixels[k] - expected;
+            if (error < 0) {
+                error = -error;
+            }
+            if (error > worst) {
+                worst = error;
+            }
+            if (error > 1.0) {
+                if (failures < 5) {
+                    printf("FAIL %s alpha %d pixel %zu/%d: s %d d %d a %d -> %d, expected %.2f\n", name, alpha, i, k,
+                        src[i].subpixels[k], base[i].subpixels[k], src[i].a, dst[i].subpixels[k], expected);
+                }
+                failures++;
+            }
+        }
+    }
+
+    printf("blend %-8s alpha %3d len %4zu: worst error %.3f LSB, %s\n", name, alpha, len, worst, failures ? "FAIL" : "OK");
+    return failures;
+}
+
+int main() {
+    static const struct {
+        uint8_t mode;
+        const char *name;
+    } modes[] = {
+        { LED_BLEND_NORMAL, "normal" },
+        { LED_BLEND_ADD, "add" },
+        { LED_BLEND_MULTIPLY, "multiply" },
+        { LED_BLEND_SCREEN, "screen" },
+    };
+    static const uint8_t alphas[] = { 0, 1, 128, 200, 255 };
+    size_t m, a;
+    int failures = 0;
+
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for (a = 0; a < sizeof(alphas); a++) {
+            failures += check(modes[m].mode, modes[m].name, alphas[a], PIXELS);
+        }
+        // A layer shorter than the base
+        failures += check(modes[m].mode, modes[m].name, 200, PIXELS / 3);
+    }
+
+    return failures ? 1 : 0;
+}
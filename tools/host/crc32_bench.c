@@ -0,0 +1,49 @@
+// Measures frame validation throughput: the CRC over frame-sized payloads, per megabyte
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc.h"
+
+#define MEGABYTE (1024 * 1024)
+#define ITERATIONS 200
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    // Header (ackID, len) plus RGB pixels, for a few strip lengths
+    static const size_t pixels[] = { 50, 300, 1000 };
+    uint8_t *buffer = malloc(MEGABYTE);
+    volatile uint32_t sink = 0;
+    size_t i, p, frame_size, offset;
+    double start, elapsed;
+    int n;
+
+    for (i = 0; i < MEGABYTE; i++) {
+        buffer[i] = (uint8_t)rand();
+    }
+
+    led_crc32_init();
+    for (p = 0; p < sizeof(pixels) / sizeof(pixels[0]); p++) {
+        frame_size = 3 + pixels[p] * 3;
+
+        start = now_seconds();
+        for (n = 0; n < ITERATIONS; n++) {
+            for (offset = 0; offset + frame_size <= MEGABYTE; offset += frame_size) {
+                sink ^= led_crc32(0, buffer + offset, frame_size);
+            }
+        }
+        elapsed = (now_seconds() - start) / ITERATIONS;
+
+        printf("crc32 %4zu px frames (%4zu B): %8.1f us/MB, %7.1f MB/s, %6.3f us/frame\n",
+            pixels[p], frame_size, elapsed * 1e6, 1.0 / elapsed,
+            elapsed * 1e6 * frame_size / MEGABYTE);
+    }
+
+    free(buffer);
+    return sink == 0x12345678; // Keep the result live
+}
@@ -0,0 +1,43 @@
+// Checks the slice-by-4 CRC32 against zlib for every alignment and a range of lengths
+#include <stdio.h>
+#include <zlib.h>
+
+#include "crc.h"
+
+#define BUFFER_SIZE 1024
+
+int main() {
+    uint8_t buffer[BUFFER_SIZE];
+    size_t offset, len;
+    int failures = 0;
+    uint32_t expected, actual;
+
+    for (len = 0; len < BUFFER_SIZE; len++) {
+        buffer[len] = (uint8_t)(len * 31 + 7);
+    }
+
+    led_crc32_init();
+    for (offset = 0; offset < 4; offset++) {
+        for (len = 0; len + offset < BUFFER_SIZE; len++) {
+            expected = crc32(0, buffer + offset, len);
+            actual = led_crc32(0, buffer + offset, len);
+            if (actual != expected) {
+                if (failures < 10) {
+                    printf("FAIL offset %zu, len %zu: %08x != %08x\n", offset, len, actual, expected);
+                }
+                failures++;
+            }
+        }
+    }
+
+    // Incremental updates must match a single pass
+    expected = crc32(0, buffer, BUFFER_SIZE);
+    actual = led_crc32(led_crc32(0, buffer, 333), buffer + 333, BUFFER_SIZE - 333);
+    if (actual != expected) {
+        printf("FAIL incremental: %08x != %08x\n", actual, expected);
+        failures++;
+    }
+
+    printf("crc32: %s (%d failures)\n", failures ? "FAIL" : "OK", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+// Replays a stream capture (tools/capture.py) through led_push_stream and led_task on the host, at the
+// original timing or a multiple of it, and reports exact drop counts, ack latency and ack behaviour.
+//
+//   replay_host [--speed X] [--loops N] [--max-drops N] [--verbose] capture.lrxc
+//   replay_host [--speed X] [--max-drops N] --synthetic FPS SECONDS
+//
+// The ws2811 driver is replaced by a model that blocks for the frame's wire time, so results depend on
+// the buffer and task logic rather than on the network or the device.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "led.h"
+
+#define CAPTURE_MAGIC "LRXC"
+#define CAPTURE_VERSION 1
+
+typedef struct {
+    int64_t time_us;
+    uint32_t len;
+    char *payload;
+} record_t;
+
+static record_t *_records = NULL;
+static size_t _record_count = 0;
+static uint8_t _verbose = false;
+
+static pthread_mutex_t _ack_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t _pending[256]; // ackID -> push time of the first frame carrying it, 0 if none
+static uint8_t _last_pushed_id = 0;
+static uint8_t _last_acked_id = 0;
+static uint32_t _ack_ids_sent = 0;
+static uint32_t _acks = 0;
+static uint32_t _unexpected_acks = 0;
+static uint32_t _overwritten = 0;
+static int64_t *_latencies = NULL;
+static size_t _latency_count = 0;
+
+static void add_record(int64_t time_us, const char *payload, uint32_t len) {
+    _records = realloc(_records, (_record_count + 1) * sizeof(record_t));
+    _records[_record_count].time_us = time_us;
+    _records[_record_count].len = len;
+    _records[_record_count].payload = malloc(len);
+    memcpy(_records[_record_count].payload, payload, len);
+    _record_count++;
+}
+
+static int load_capture(const char *path) {
+    FILE *f = fopen(path, "rb");
+    char magic[4];
+    uint16_t version;
+    uint64_t time_us;
+    uint32_t len;
+    char *payload;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (fread(magic, 1, 4, f) != 4 || fread(&version, 2, 1, f) != 1 ||
+            memcmp(magic, CAPTURE_MAGIC, 4) != 0 || version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s: not a ledrx capture\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    while (fread(&time_us, 8, 1, f) == 1 && fread(&len, 4, 1, f) == 1) {
+        payload = malloc(len);
+        if (fread(payload, 1, len, f) != len) {
+            free(payload);
+            break;
+        }
+        add_record((int64_t)time_us, payload, len);
+        free(payload);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Full-length frames at a fixed rate, with ack IDs cycling through 1-255
+static void make_synthetic(double fps, double seconds) {
+    size_t size = sizeof(FRAME_t);
+    FRAME_t *frame = calloc(1, size);
+    size_t i, count = (size_t)(fps * seconds);
+
+    for (i = 0; i < count; i++) {
+        frame->ackID = (i % 255) + 1;
+        frame->len = CONFIG_LED_NUM_PIXELS;
+        memset(frame->data, (int)i, sizeof(frame->data));
+        add_record((int64_t)(i * 1000000.0 / fps), (char *)frame, size);
+    }
+    free(frame);
+}
+
+static void on_push(uint8_t ack_id, int64_t now) {
+    pthread_mutex_lock(&_ack_lock);
+    // The firmware only acks when the ID changes, so repeats of an ID share one ack
+    if (ack_id != 0 && ack_id != _last_pushed_id) {
+        if (_pending[ack_id] != 0) {
+            _overwritten++;
+        }
+        _pending[ack_id] = now;
+        _ack_ids_sent++;
+    }
+    _last_pushed_id = ack_id;
+    pthread_mutex_unlock(&_ack_lock);
+}
+
+// Mirrors led_ack_callback in app_main.c, which publishes an ack when the ID changes
+static void ack_callback(uint8_t ack_id) {
+    int64_t now = esp_timer_get_time();
+
+    pthread_mutex_lock(&_ack_lock);
+    if (ack_id != _last_acked_id && ack_id != 0) {
+        _acks++;
+        if (_pending[ack_id] == 0) {
+            _unexpected_acks++;
+        }
+        else {
+            _latencies[_latency_count++] = now - _pending[ack_id];
+            _pending[ack_id] = 0;
+        }
+    }
+    _last_acked_id = ack_id;
+    pthread_mutex_unlock(&_ack_lock);
+}
+
+static void log_callback(char *message) {
+    if (_verbose) {
+        fprintf(stderr, "LOG %s\n", message);
+    }
+}
+
+static void *run_led_task(void *arg) {
+    led_task(arg);
+    return NULL;
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(int64_t *values, size_t count, double p) {
+    if (count == 0) {
+        return 0;
+    }
+    return values[(size_t)(p / 100.0 * (count - 1) + 0.5)] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+    double speed = 1.0;
+    int loops = 1;
+    long max_drops = -1;
+    const char *capture = NULL;
+    double synthetic_fps = 0, synthetic_seconds = 0;
+    int gpios[2] = { 0, 0 };
+    pthread_t thread;
+    led_stats_t stats;
+    int64_t start, offset = 0, due, now, *lateness;
+    size_t i, pushes = 0, missing;
+    int loop, a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--speed") == 0 && a + 1 < argc) {
+            speed = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--loops") == 0 && a + 1 < argc) {
+            loops = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--max-drops") == 0 && a + 1 < argc) {
+            max_drops = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--synthetic") == 0 && a + 2 < argc) {
+            synthetic_fps = atof(argv[++a]);
+            synthetic_seconds = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--verbose") == 0) {
+            _verbose = true;
+        }
+        else if (argv[a][0] != '-' && capture == NULL) {
+            capture = argv[a];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--speed X] [--loops N] [--max-drops N] [--verbose] "
+                "(capture | --synthetic FPS SECONDS)\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (synthetic_fps > 0) {
+        make_synthetic(synthetic_fps, synthetic_seconds);
+    }
+    else if (capture == NULL || load_capture(capture) != 0) {
+        fprintf(stderr, "No capture given\n");
+        return 2;
+    }
+    if (_record_count == 0 || speed <= 0 || loops < 1) {
+        fprintf(stderr, "Nothing to replay\n");
+        return 2;
+    }
+
+    _latencies = calloc(_record_count * loops, sizeof(int64_t));
+    lateness = calloc(_record_count * loops, sizeof(int64_t));
+
+    led_initialise(log_callback, ack_callback, gpios, 2);
+    pthread_create(&thread, NULL, run_led_task, NULL);
+
+    start = esp_timer_get_time();
+    for (loop = 0; loop < loops; loop++) {
+        for (i = 0; i < _record_count; i++) {
+            due = start + offset + (int64_t)(_records[i].time_us / speed);
+            now = esp_timer_get_time();
+            if (due > now) {
+                vTaskDelay((due - now) / 1000);
+                while ((now = esp_timer_get_time()) < due);
+            }
+            lateness[pushes++] = now - due;
+
+            on_push(_records[i].len > 0 ? (uint8_t)_records[i].payload[0] : 0, now);
+            led_push_stream(_records[i].payload, _records[i].len);
+        }
+        offset += (int64_t)(_records[_record_count - 1].time_us / speed);
+    }
+    double elapsed = (esp_timer_get_time() - start) / 1000000.0;
+
+    // Let the task drain the frame buffer
+    for (i = 0; i < 200; i++) {
+        led_get_stats(&stats);
+        if (stats.rendered + stats.skipped >= stats.accepted) {
+            break;
+        }
+        vTaskDelay(10);
+    }
+    vTaskDelay(50);
+
+    led_get_stats(&stats);
+    pthread_mutex_lock(&_ack_lock);
+    missing = _ack_ids_sent - (_acks - _unexpected_acks);
+    qsort(_latencies, _latency_count, sizeof(int64_t), compare_int64);
+    qsort(lateness, pushes, sizeof(int64_t), compare_int64);
+
+    printf("Frames pushed:    %zu in %.2fs (speed x%.2f)\n", pushes, elapsed, speed);
+    printf("Accepted:         %u\n", stats.accepted);
+    printf("Dropped:          %u\n", stats.dropped);
+    printf("Rejected:         %u\n", stats.rejected);
+    printf("Skipped:          %u\n", stats.skipped);
+    printf("Rendered:         %u\n", stats.rendered);
+    printf("Slow wakes:       %u\n", stats.slow_wakes);
+    printf("Push lateness:    p50 %.3fms, p99 %.3fms\n",
+        percentile_ms(lateness, pushes, 50), percentile_ms(lateness, pushes, 99));
+    printf("Acks:             %u for %u ack IDs sent, %zu missing (%u overwritten), %u unexpected\n",
+        _acks, _ack_ids_sent, missing, _overwritten, _unexpected_acks);
+    printf("Ack latency:      p50 %.2fms, p90 %.2fms, p99 %.2fms, max %.2fms\n",
+        percentile_ms(_latencies, _latency_count, 50), percentile_ms(_latencies, _latency_count, 90),
+        percentile_ms(_latencies, _latency_count, 99), percentile_ms(_latencies, _latency_count, 100));
+    pthread_mutex_unlock(&_ack_lock);
+
+    if (max_drops >= 0 && stats.dropped > (uint32_t)max_drops) {
+        printf("FAIL: %u drops exceeds the limit of %ld\n", stats.dropped, max_drops);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1 @@
+// Power management is not modelled on the host (CONFIG_PM_ENABLE is never set)
@@ -0,0 +1,8 @@
+#include <stdint.h>
+
+#ifndef __HOST_ESP_TIMER_H
+#define __HOST_ESP_TIMER_H
+
+int64_t esp_timer_get_time(void);
+
+#endif
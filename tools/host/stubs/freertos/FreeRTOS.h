@@ -0,0 +1,19 @@
+// Host stand-in for the FreeRTOS headers used by the LED components
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef __HOST_FREERTOS_H
+#define __HOST_FREERTOS_H
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define portNUM_PROCESSORS 2
+
+#endif
@@ -0,0 +1,13 @@
+#include "freertos/FreeRTOS.h"
+
+#ifndef __HOST_SEMPHR_H
+#define __HOST_SEMPHR_H
+
+typedef struct host_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+#endif
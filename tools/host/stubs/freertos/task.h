@@ -0,0 +1,8 @@
+#include "freertos/FreeRTOS.h"
+
+#ifndef __HOST_TASK_H
+#define __HOST_TASK_H
+
+void vTaskDelay(TickType_t ticks);
+
+#endif
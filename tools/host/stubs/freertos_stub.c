@@ -0,0 +1,83 @@
+// pthread-backed implementations of the FreeRTOS and esp_timer calls used by the LED components
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t given;
+};
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sched_yield();
+    }
+    else {
+        usleep(ticks * portTICK_PERIOD_MS * 1000);
+    }
+}
+
+static SemaphoreHandle_t semaphore_create(uint8_t given) {
+    SemaphoreHandle_t sem = calloc(1, sizeof(struct host_semaphore));
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->given = given;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return semaphore_create(false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return semaphore_create(true);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec deadline;
+    int64_t until;
+    int result = 0;
+
+    pthread_mutex_lock(&sem->lock);
+    if (ticks == portMAX_DELAY) {
+        while (!sem->given) {
+            pthread_cond_wait(&sem->cond, &sem->lock);
+        }
+    }
+    else {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        until = (int64_t)deadline.tv_nsec + (int64_t)ticks * portTICK_PERIOD_MS * 1000000;
+        deadline.tv_sec += until / 1000000000;
+        deadline.tv_nsec = until % 1000000000;
+        while (!sem->given && result == 0) {
+            result = pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline);
+        }
+    }
+
+    BaseType_t taken = sem->given ? pdTRUE : pdFALSE;
+    sem->given = false;
+    pthread_mutex_unlock(&sem->lock);
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sem->lock);
+    sem->given = true;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+    return pdTRUE;
+}
@@ -0,0 +1 @@
+// The LED component includes this but does not use the MQTT client
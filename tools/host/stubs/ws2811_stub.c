@@ -0,0 +1,44 @@
+// Host model of the WS2811 driver: setColors blocks for the time the frame would take on the wire
+#include <string.h>
+#include <unistd.h>
+
+#include "ws2811.h"
+
+#define BIT_NS 2500     /* ONE/ZERO pulse of 50 ticks at 50ns */
+#define RESET_NS 50000  /* RESET_TICKS */
+
+static size_t _channel_count = 1;
+
+void ws2811_init(int *gpioNum, size_t count) {
+    (void)gpioNum;
+    _channel_count = count;
+}
+
+void ws2811_setColors(unsigned int length, RGB_t *array) {
+    (void)array;
+
+    // Channels transmit in parallel, each carrying its share of the pixels
+    uint64_t ns = (uint64_t)(length / _channel_count) * 24 * BIT_NS + RESET_NS;
+    usleep(ns / 1000);
+}
+
+void ws2811_getStats(uint8_t channel, ws2811_channel_stats_t *stats) {
+    (void)channel;
+    memset(stats, 0, sizeof(ws2811_channel_stats_t));
+}
+
+void ws2811_resetStats(void) {
+}
+
+void ws2811_sleep(void) {
+}
+
+void ws2811_wake(void) {
+}
+
+uint8_t ws2811_calibrate(unsigned int length, RGB_t *array, uint16_t frames) {
+    (void)length;
+    (void)array;
+    (void)frames;
+    return 2;
+}
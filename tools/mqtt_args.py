@@ -0,0 +1,21 @@
+from urllib.parse import urlparse
+
+import paho.mqtt.client as mqtt
+
+
+def add_arguments(parser):
+    parser.add_argument('--broker', default='mqtt://localhost', help='Broker URL, e.g. mqtt://host:1883')
+    parser.add_argument('--username', default=None)
+    parser.add_argument('--password', default=None)
+    parser.add_argument('--topic', default='home/ledrx/stream', help='LED stream topic (CONFIG_LED_TOPIC_STREAM)')
+
+
+def connect(args, on_message=None):
+    url = urlparse(args.broker)
+    client = mqtt.Client()
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    if on_message:
+        client.on_message = on_message
+    client.connect(url.hostname, url.port or 1883)
+    return client
@@ -0,0 +1,136 @@
+import argparse
+import json
+import re
+import sys
+import threading
+import time
+
+import capture_format
+import mqtt_args
+
+REJECT_RE = re.compile(r'^BUF REJECT \(L:(?P<length>\d+), C:(?P<crc>\d+)')
+FPS_RE = re.compile(r'^LED FPS (?P<fps>[\d.]+)')
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.sent = 0
+        self.sent_ack_ids = 0
+        self.pending = {}  # ackID -> publish time of the first frame carrying it
+        self.last_ack_id = 0
+        self.overwritten = 0
+        self.latencies = []
+        self.acks = 0
+        self.unexpected_acks = 0
+        self.rejects = 0
+        self.render_fps = []
+
+    def on_publish(self, payload, now):
+        with self.lock:
+            self.sent += 1
+            ack_id = payload[0] if payload else 0
+            # The device only acks when the ID changes, so repeats of the same ID share one ack
+            if ack_id != 0 and ack_id != self.last_ack_id:
+                if ack_id in self.pending:
+                    # The ID has wrapped before the previous use of it was acked
+                    self.overwritten += 1
+                self.sent_ack_ids += 1
+                self.pending[ack_id] = now
+            self.last_ack_id = ack_id
+
+    def on_ack(self, ack_id, now):
+        with self.lock:
+            self.acks += 1
+            sent = self.pending.pop(ack_id, None)
+            if sent is None:
+                self.unexpected_acks += 1
+            else:
+                self.latencies.append(now - sent)
+
+    def on_log(self, message):
+        with self.lock:
+            m = REJECT_RE.match(message)
+            if m:
+                self.rejects += int(m.group('length')) + int(m.group('crc'))
+            m = FPS_RE.match(message)
+            if m:
+                self.render_fps.append(float(m.group('fps')))
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a capture to the LED stream topic at its original timing.')
+    mqtt_args.add_arguments(parser)
+    parser.add_argument('--ack-topic', default='home/xmastree/ack')
+    parser.add_argument('--log-topic', default='home/xmastree/log')
+    parser.add_argument('--speed', type=float, default=1.0, help='Timing multiplier, 2 replays twice as fast')
+    parser.add_argument('--loops', type=int, default=1)
+    parser.add_argument('--settle', type=float, default=2.0, help='Seconds to wait for acks and logs after the last frame')
+    parser.add_argument('input', help='Capture file to replay')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        records = list(capture_format.read_records(f))
+    if not records:
+        print('Capture is empty', file=sys.stderr)
+        return 1
+
+    results = Results()
+
+    def on_message(client, userdata, msg):
+        now = time.perf_counter()
+        if msg.topic == args.ack_topic:
+            results.on_ack(json.loads(msg.payload)['ackID'], now)
+        elif msg.topic == args.log_topic:
+            results.on_log(msg.payload.decode('utf-8', 'replace'))
+
+    client = mqtt_args.connect(args, on_message)
+    client.subscribe(args.ack_topic, 0)
+    client.subscribe(args.log_topic, 0)
+    client.loop_start()
+
+    start = time.perf_counter()
+    offset = 0.0
+    lateness = []
+    for _ in range(args.loops):
+        for time_us, payload in records:
+            due = start + offset + time_us / 1000000.0 / args.speed
+            delay = due - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+            now = time.perf_counter()
+            lateness.append(now - due)
+            client.publish(args.topic, payload, 0)
+            results.on_publish(payload, now)
+        offset += records[-1][0] / 1000000.0 / args.speed
+    elapsed = time.perf_counter() - start
+
+    time.sleep(args.settle)
+    client.loop_stop()
+    client.disconnect()
+
+    ms = [l * 1000.0 for l in results.latencies]
+    print('Frames sent:      {} in {:.1f}s ({:.1f} fps, speed x{})'.format(
+        results.sent, elapsed, results.sent / elapsed if elapsed > 0 else 0, args.speed))
+    print('Replay lateness:  p50 {:.2f}ms, p99 {:.2f}ms'.format(
+        percentile(lateness, 50) * 1000.0, percentile(lateness, 99) * 1000.0))
+    print('Rejected:         {}'.format(results.rejects))
+    if results.render_fps:
+        print('Render fps:       min {:.1f}, mean {:.1f}'.format(
+            min(results.render_fps), sum(results.render_fps) / len(results.render_fps)))
+    print('Acks:             {} received for {} ack IDs sent, {} missing, {} unexpected'.format(
+        results.acks, results.sent_ack_ids, len(results.pending) + results.overwritten, results.unexpected_acks))
+    print('Ack latency:      p50 {:.1f}ms, p90 {:.1f}ms, p99 {:.1f}ms, max {:.1f}ms'.format(
+        percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), max(ms) if ms else float('nan')))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())